@@ -0,0 +1,775 @@
+// Headless differential conformance harness.
+//
+// Runs the reference interpreter (Chip8::execute -> Chip8::apply_opcode) and a
+// candidate engine in lockstep, on randomly generated instruction streams and
+// on rom files. The candidate may retire several instructions per call; the
+// reference is brought up to the same count and their state compared every
+// few steps. On the first
+// divergence it stops every worker, shrinks the failing case and prints a
+// minimal reproducer.
+//
+// Usage: conformance [options] [rom.ch8 ...]   (roms default to roms/*.ch8)
+//   -e NAME    candidate engine (default: the last one in ENGINES)
+//   -n N       number of random instruction streams (default 10000)
+//   -l N       instructions per random stream, at most 1792 (default 64)
+//   -s N       maximum steps per case (default 2000)
+//   -c N       compare state every N steps, or only at the end of each case if
+//              N is 0 (default 1); N may not exceed -s
+//   -r N       runs per rom, each with a different key schedule (default 16)
+//   -j N       worker threads (default: all cores)
+//   -S N       base seed (default 1)
+//   -o FILE    write the shrunk reproducer rom to FILE and the keys pressed at
+//              each step to FILE.keys
+//   -k FILE    press the keys in FILE (as written by -o) on every rom run,
+//              e.g. `conformance -n 0 -r 1 -k repro.ch8.keys repro.ch8`
+//
+// `make conformance-selftest` builds it with deliberately broken engines and
+// checks that each one is caught and shrunk to a one-instruction reproducer.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <glob.h>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "emulator.hpp"
+
+#define DEFAULT_ROMS "roms/*.ch8"
+#define STEPS_PER_TIMER_TICK 5 // 300 hz clock / 60 hz timers, as in main.cpp
+
+// Whether an engine has defined behaviour for its next step. Opcode 0x0000
+// exits the process and the rest would index past the end of an array, so a
+// case simply ends when it gets here.
+bool can_step(Chip8 const& chip8) {
+    if (chip8.waiting_for_key) {
+        return true;
+    }
+    uint16_t const pc = chip8.pc + INSTRUCTION_SIZE; // Wraps like execute().
+    if (pc + 1u >= sizeof(chip8.memory)) {
+        return false;
+    }
+    uint16_t const opcode = chip8.memory[pc] << 8 | chip8.memory[pc + 1];
+    uint8_t const x = (opcode & 0x0f00) >> 8;
+    size_t const stack_size = sizeof(chip8.stack) / sizeof(chip8.stack[0]);
+    size_t const mem_size = sizeof(chip8.memory);
+    if (opcode == 0x0000) {
+        return false;
+    }
+    else if (opcode == 0x00ee) {
+        return chip8.sp < stack_size;
+    }
+    else if ((opcode & 0xf000) == 0x2000) {
+        return chip8.sp + 1u < stack_size;
+    }
+    else if ((opcode & 0xf000) == 0xd000) {
+        return chip8.i + (opcode & 0x000fu) <= mem_size;
+    }
+    else if ((opcode & 0xf0ff) == 0xe09e || (opcode & 0xf0ff) == 0xe0a1) {
+        return chip8.registers[x] < NUM_KEYS;
+    }
+    else if ((opcode & 0xf0ff) == 0xf033) {
+        return chip8.i + 3u <= mem_size;
+    }
+    else if ((opcode & 0xf0ff) == 0xf055 || (opcode & 0xf0ff) == 0xf065) {
+        return chip8.i + x + 1u <= mem_size;
+    }
+    return true;
+}
+
+// An execution engine under test. The harness creates a fresh instance for
+// every case, so predecode caches, translated blocks and the like can live in
+// the instance without being shared between worker threads.
+class Engine {
+public:
+    virtual ~Engine() {}
+
+    // Executes up to max_steps instructions on chip8 and returns how many were
+    // retired. An engine may stop early, e.g. at the end of a fused block, but
+    // must retire at least one instruction when can_step(chip8) holds and must
+    // never execute one for which it does not.
+    virtual size_t run(Chip8& chip8, size_t max_steps) = 0;
+};
+
+// One instruction at a time through Chip8::execute().
+class InterpreterEngine : public Engine {
+public:
+    size_t run(Chip8& chip8, size_t max_steps) override {
+        size_t retired = 0;
+        while (retired < max_steps && can_step(chip8)) {
+            step(chip8);
+            retired++;
+        }
+        return retired;
+    }
+
+protected:
+    virtual void step(Chip8& chip8) {
+        chip8.execute();
+    }
+};
+
+#ifdef CONFORMANCE_SELFTEST
+// Deliberately broken engines for `make conformance-selftest`, which checks
+// that the harness catches and shrinks a divergence.
+
+// The opcode execute() is about to run, or 0 while waiting for a key.
+uint16_t next_opcode(Chip8 const& chip8) {
+    if (chip8.waiting_for_key) {
+        return 0;
+    }
+    uint16_t const pc = chip8.pc + INSTRUCTION_SIZE;
+    return chip8.memory[pc] << 8 | chip8.memory[pc + 1];
+}
+
+// Flips VF after 8xy4.
+class FaultyAddregEngine : public InterpreterEngine {
+protected:
+    void step(Chip8& chip8) override {
+        uint16_t const opcode = next_opcode(chip8);
+        chip8.execute();
+        if ((opcode & 0xf00f) == 0x8004) {
+            chip8.registers[0xF] ^= 1;
+        }
+    }
+};
+
+// Jumps into empty memory after 6xkk.
+class FaultyPcEngine : public InterpreterEngine {
+protected:
+    void step(Chip8& chip8) override {
+        uint16_t const opcode = next_opcode(chip8);
+        chip8.execute();
+        if ((opcode & 0xf000) == 0x6000) {
+            chip8.pc = 0x400;
+        }
+    }
+};
+
+// Flips V3 when key 5 is held during Ex9E.
+class FaultySkpEngine : public InterpreterEngine {
+protected:
+    void step(Chip8& chip8) override {
+        uint16_t const opcode = next_opcode(chip8);
+        chip8.execute();
+        if ((opcode & 0xf0ff) == 0xe09e && chip8.keys_pressed[5]) {
+            chip8.registers[3] ^= 1;
+        }
+    }
+};
+#endif
+
+template <typename T>
+Engine* create_engine() {
+    return new T();
+}
+
+struct EngineType {
+    char const* name;
+    Engine* (*create)();
+};
+
+// Faster execution paths register themselves here. The reference is listed so
+// the harness can check itself when no other engine is built in.
+EngineType const ENGINES[] = {
+#ifdef CONFORMANCE_SELFTEST
+    {"faulty_addreg", create_engine<FaultyAddregEngine>},
+    {"faulty_pc", create_engine<FaultyPcEngine>},
+    {"faulty_skp", create_engine<FaultySkpEngine>},
+#endif
+    {"reference", create_engine<InterpreterEngine>},
+};
+size_t const NUM_ENGINES = sizeof(ENGINES) / sizeof(ENGINES[0]);
+
+struct Case {
+    std::string name;
+    std::vector<uint16_t> program; // Loaded big-endian at ROM_ADDRESS.
+    std::vector<uint16_t> keys;    // Bitmask of pressed keys for each step.
+    size_t steps = 0;
+};
+
+struct Divergence {
+    bool found = false;
+    size_t step = 0; // Number of steps executed when the mismatch was seen.
+    std::string what;
+};
+
+struct Options {
+    EngineType const* candidate = &ENGINES[NUM_ENGINES - 1];
+    size_t num_random = 10000;
+    size_t stream_length = 64;
+    size_t max_steps = 2000;
+    size_t compare_interval = 1;
+    size_t runs_per_rom = 16;
+    size_t num_threads = 0;
+    uint32_t seed = 1;
+    std::string output;
+    std::vector<uint16_t> replay_keys;
+    bool replay = false;
+    std::vector<std::string> roms;
+};
+
+std::string hex(unsigned int val) {
+    std::ostringstream out;
+    out << "0x" << std::hex << std::uppercase << val;
+    return out.str();
+}
+
+std::string mismatch(std::string const& field, unsigned int ref, unsigned int cand) {
+    return field + ": reference " + hex(ref) + ", candidate " + hex(cand);
+}
+
+// Returns a description of the first field that differs, or "" if none do.
+std::string compare(Chip8 const& ref, Chip8 const& cand) {
+    if (std::memcmp(ref.registers, cand.registers, sizeof(ref.registers)) == 0 &&
+        ref.pc == cand.pc && ref.i == cand.i && ref.sp == cand.sp && ref.dt == cand.dt && ref.st == cand.st &&
+        ref.waiting_for_key == cand.waiting_for_key && ref.key_register == cand.key_register &&
+        std::memcmp(ref.memory, cand.memory, sizeof(ref.memory)) == 0 &&
+        std::memcmp(ref.stack, cand.stack, sizeof(ref.stack)) == 0 &&
+        std::memcmp(ref.screen, cand.screen, sizeof(ref.screen)) == 0) {
+        return "";
+    }
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        if (ref.registers[r] != cand.registers[r]) {
+            return mismatch("V" + hex(r).substr(2), ref.registers[r], cand.registers[r]);
+        }
+    }
+    if (ref.pc != cand.pc) return mismatch("PC", ref.pc, cand.pc);
+    if (ref.i != cand.i) return mismatch("I", ref.i, cand.i);
+    if (ref.sp != cand.sp) return mismatch("SP", ref.sp, cand.sp);
+    if (ref.dt != cand.dt) return mismatch("DT", ref.dt, cand.dt);
+    if (ref.st != cand.st) return mismatch("ST", ref.st, cand.st);
+    if (ref.waiting_for_key != cand.waiting_for_key) return mismatch("waiting_for_key", ref.waiting_for_key, cand.waiting_for_key);
+    if (ref.key_register != cand.key_register) return mismatch("key_register", ref.key_register, cand.key_register);
+    for (size_t addr = 0; addr < sizeof(ref.memory); addr++) {
+        if (ref.memory[addr] != cand.memory[addr]) {
+            return mismatch("memory[" + hex(addr) + "]", ref.memory[addr], cand.memory[addr]);
+        }
+    }
+    for (size_t idx = 0; idx < sizeof(ref.stack) / sizeof(ref.stack[0]); idx++) {
+        if (ref.stack[idx] != cand.stack[idx]) {
+            return mismatch("stack[" + hex(idx) + "]", ref.stack[idx], cand.stack[idx]);
+        }
+    }
+    for (int px = 0; px < NUM_PX; px++) {
+        if (ref.screen[px] != cand.screen[px]) {
+            return mismatch("pixel (" + std::to_string(px / CHIP8_SCREEN_WIDTH) + ", " + std::to_string(px % CHIP8_SCREEN_WIDTH) + ")", ref.screen[px], cand.screen[px]);
+        }
+    }
+    return "";
+}
+
+Chip8 load(Case const& c) {
+    std::vector<uint8_t> rom;
+    for (uint16_t word : c.program) {
+        rom.push_back(word >> 8);
+        rom.push_back(word & 0xff);
+    }
+    Chip8 chip8(rom.data(), rom.size());
+    chip8.verbose = false;
+    return chip8;
+}
+
+void press_keys(Chip8& chip8, uint16_t mask) {
+    for (int key = 0; key < NUM_KEYS; key++) {
+        chip8.keys_pressed[key] = mask >> key & 1;
+    }
+}
+
+Divergence diverged(Chip8 const& ref, Chip8 const& cand, size_t step, std::string const& fallback) {
+    Divergence result;
+    result.found = true;
+    result.step = step;
+    result.what = compare(ref, cand);
+    if (result.what == "") {
+        result.what = fallback;
+    }
+    return result;
+}
+
+// Lets the candidate run ahead as far as the next checkpoint, then brings the
+// reference up to the number of instructions the candidate retired. Key
+// changes and timer ticks are checkpoints too, since both engines must see
+// them at the same instruction. A zero interval compares only at the end.
+Divergence run(Case const& c, EngineType const& candidate, size_t interval) {
+    std::unique_ptr<Engine> engine(candidate.create());
+    Chip8 ref = load(c);
+    Chip8 cand = ref;
+    size_t step = 0;
+    while (step < c.steps) {
+        uint16_t const keys = step < c.keys.size() ? c.keys[step] : 0;
+        size_t checkpoint = std::min(c.steps, (step / STEPS_PER_TIMER_TICK + 1) * STEPS_PER_TIMER_TICK);
+        if (interval != 0) {
+            checkpoint = std::min(checkpoint, (step / interval + 1) * interval);
+        }
+        for (size_t next = step + 1; next < checkpoint; next++) {
+            if ((next < c.keys.size() ? c.keys[next] : 0) != keys) {
+                checkpoint = next;
+                break;
+            }
+        }
+
+        press_keys(ref, keys);
+        press_keys(cand, keys);
+        size_t const retired = engine->run(cand, checkpoint - step);
+        if (retired > checkpoint - step) {
+            return diverged(ref, cand, step, "candidate retired " + std::to_string(retired) + " of " + std::to_string(checkpoint - step) + " instructions");
+        }
+        // Never step the reference into undefined behaviour; if only one of
+        // the engines can go on, their states already differ.
+        for (size_t n = 0; n < retired; n++) {
+            if (!can_step(ref)) {
+                return diverged(ref, cand, step + n, "candidate ran past where the reference stops");
+            }
+            ref.execute();
+        }
+        if (retired == 0) {
+            if (can_step(ref)) {
+                return diverged(ref, cand, step, "candidate stopped where the reference can go on");
+            }
+            break;
+        }
+        step += retired;
+
+        if (step % STEPS_PER_TIMER_TICK == 0) {
+            ref.update_timers();
+            cand.update_timers();
+        }
+        if (interval != 0 && step % interval == 0) {
+            Divergence result;
+            result.what = compare(ref, cand);
+            if (result.what != "") {
+                result.found = true;
+                result.step = step;
+                return result;
+            }
+        }
+    }
+    Divergence result;
+    result.what = compare(ref, cand);
+    result.found = result.what != "";
+    result.step = step;
+    return result;
+}
+
+// Opcode templates: the bits in mask are filled in at random.
+struct Template {
+    uint16_t base;
+    uint16_t mask;
+};
+
+Template const TEMPLATES[] = {
+    {0x00e0, 0x0000}, {0x00ee, 0x0000}, {0x1000, 0x0fff}, {0x2000, 0x0fff},
+    {0x3000, 0x0fff}, {0x4000, 0x0fff}, {0x5000, 0x0ff0}, {0x6000, 0x0fff},
+    {0x7000, 0x0fff}, {0x8000, 0x0ff0}, {0x8001, 0x0ff0}, {0x8002, 0x0ff0},
+    {0x8003, 0x0ff0}, {0x8004, 0x0ff0}, {0x8005, 0x0ff0}, {0x8006, 0x0ff0},
+    {0x8007, 0x0ff0}, {0x800e, 0x0ff0}, {0x9000, 0x0ff0}, {0xa000, 0x0fff},
+    {0xb000, 0x0fff}, {0xc000, 0x0fff}, {0xd000, 0x0fff}, {0xe09e, 0x0f00},
+    {0xe0a1, 0x0f00}, {0xf007, 0x0f00}, {0xf00a, 0x0f00}, {0xf015, 0x0f00},
+    {0xf018, 0x0f00}, {0xf01e, 0x0f00}, {0xf029, 0x0f00}, {0xf033, 0x0f00},
+    {0xf055, 0x0f00}, {0xf065, 0x0f00}, {0x0000, 0xffff}, // last one is any word at all
+};
+size_t const NUM_TEMPLATES = sizeof(TEMPLATES) / sizeof(TEMPLATES[0]);
+
+// A return is only emitted when the stream so far has more calls than
+// returns; with an empty stack it would send pc to 0 and end the case.
+uint16_t random_opcode(std::mt19937& rng, size_t stream_length, bool may_return) {
+    Template const* t = &TEMPLATES[rng() % NUM_TEMPLATES];
+    while (t->base == 0x00ee && !may_return) {
+        t = &TEMPLATES[rng() % NUM_TEMPLATES];
+    }
+    uint16_t opcode = t->base | (rng() & t->mask);
+    uint16_t const kind = opcode & 0xf000;
+    // Keep most jumps and calls inside the stream so it does not just run off
+    // into empty memory. Bnnn adds V0, so it is aimed at the start.
+    if ((kind == 0x1000 || kind == 0x2000) && rng() % 32 != 0) {
+        opcode = kind | (ROM_ADDRESS + INSTRUCTION_SIZE * (rng() % stream_length));
+    }
+    else if (kind == 0xb000 && rng() % 32 != 0) {
+        opcode = kind | ROM_ADDRESS;
+    }
+    return opcode;
+}
+
+std::vector<uint16_t> random_keys(std::mt19937& rng, size_t steps) {
+    std::vector<uint16_t> keys(steps);
+    uint16_t mask = 0;
+    for (size_t step = 0; step < steps; step++) {
+        if (step % STEPS_PER_TIMER_TICK == 0) {
+            mask = rng() % 4 == 0 ? rng() & 0xffff : 0;
+        }
+        keys[step] = mask;
+    }
+    return keys;
+}
+
+Case random_case(Options const& opts, size_t index) {
+    std::mt19937 rng(opts.seed + index);
+    Case c;
+    c.name = "random stream " + std::to_string(index) + " (seed " + std::to_string(opts.seed + index) + ")";
+    size_t open_calls = 1; // For the call added below.
+    for (size_t n = 0; n < opts.stream_length; n++) {
+        c.program.push_back(random_opcode(rng, opts.stream_length, open_calls > 0));
+        if ((c.program.back() & 0xf000) == 0x2000) {
+            open_calls++;
+        }
+        else if (c.program.back() == 0x00ee) {
+            open_calls--;
+        }
+    }
+    // Start with a call into the stream, so that a return reached without a
+    // matching call lands back at the second instruction, and end with a jump
+    // back into it instead of running off into empty memory.
+    if (opts.stream_length >= 3) {
+        c.program.front() = 0x2000 | (ROM_ADDRESS + INSTRUCTION_SIZE * (1 + rng() % (opts.stream_length - 1)));
+        c.program.back() = 0x1000 | (ROM_ADDRESS + INSTRUCTION_SIZE * (rng() % (opts.stream_length - 1)));
+    }
+    c.keys = random_keys(rng, opts.max_steps);
+    c.steps = opts.max_steps;
+    return c;
+}
+
+bool read_rom(std::string const& path, std::vector<uint16_t>& program) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (bytes.size() % 2 != 0) {
+        bytes.push_back(0);
+    }
+    program.clear();
+    for (size_t b = 0; b < bytes.size(); b += 2) {
+        program.push_back(bytes[b] << 8 | bytes[b + 1]);
+    }
+    return true;
+}
+
+bool read_keys(std::string const& path, std::vector<uint16_t>& keys) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    keys.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        keys.push_back(std::strtoul(line.c_str(), NULL, 0));
+    }
+    return true;
+}
+
+Case rom_case(Options const& opts, std::vector<uint16_t> const& program, size_t rom, size_t run) {
+    std::mt19937 rng(opts.seed + opts.num_random + rom * opts.runs_per_rom + run);
+    Case c;
+    c.name = opts.roms[rom] + " run " + std::to_string(run);
+    c.program = program;
+    // The first run of every rom leaves the keyboard alone.
+    if (opts.replay) {
+        c.keys = opts.replay_keys;
+    }
+    else if (run != 0) {
+        c.keys = random_keys(rng, opts.max_steps);
+    }
+    c.steps = opts.max_steps;
+    return c;
+}
+
+// Removes program[start, end) and moves jump (1nnn, Bnnn) and call targets
+// that pointed past the removed words back by the same amount.
+void erase_instructions(std::vector<uint16_t>& program, size_t start, size_t end) {
+    uint16_t const first = ROM_ADDRESS + INSTRUCTION_SIZE * start;
+    uint16_t const last = ROM_ADDRESS + INSTRUCTION_SIZE * end;
+    program.erase(program.begin() + start, program.begin() + end);
+    for (uint16_t& opcode : program) {
+        uint16_t const kind = opcode & 0xf000;
+        uint16_t const target = opcode & 0x0fff;
+        if ((kind == 0x1000 || kind == 0x2000 || kind == 0xb000) && target >= last) {
+            opcode = kind | (target - (last - first));
+        }
+    }
+}
+
+// Delta debugging over the program: drop ever smaller runs of instructions as
+// long as the case keeps failing.
+void shrink_program(Case& c, EngineType const& candidate) {
+    for (size_t chunk = c.program.size() / 2; chunk >= 1; chunk /= 2) {
+        for (size_t start = 0; start < c.program.size();) {
+            Case attempt = c;
+            erase_instructions(attempt.program, start, std::min(start + chunk, attempt.program.size()));
+            if (run(attempt, candidate, 1).found) {
+                c = attempt;
+            }
+            else {
+                start += chunk;
+            }
+        }
+    }
+}
+
+// Minimizes the key schedule one key at a time. Unless per_step is set, keys
+// are only ever released for the whole run, so the schedule stays independent
+// of timing and removing instructions does not shift it against the program.
+void shrink_keys(Case& c, EngineType const& candidate, bool per_step) {
+    uint16_t held = 0;
+    for (uint16_t mask : c.keys) {
+        held |= mask;
+    }
+    if (held == 0) {
+        return;
+    }
+
+    // Try with nothing pressed, then with every key that is ever pressed held
+    // for the whole run.
+    Case attempt = c;
+    attempt.keys.clear();
+    if (run(attempt, candidate, 1).found) {
+        c = attempt;
+        return;
+    }
+    attempt.keys.assign(c.steps, held);
+    if (attempt.keys != c.keys && run(attempt, candidate, 1).found) {
+        c = attempt;
+    }
+
+    for (int key = 0; key < NUM_KEYS; key++) {
+        uint16_t const bit = 1 << key;
+        if (!(held & bit)) {
+            continue;
+        }
+        // Release the key over ever smaller runs of steps.
+        for (size_t chunk = c.keys.size(); chunk >= 1; chunk = per_step ? chunk / 2 : 0) {
+            for (size_t start = 0; start < c.keys.size(); start += chunk) {
+                attempt = c;
+                for (size_t step = start; step < std::min(start + chunk, attempt.keys.size()); step++) {
+                    attempt.keys[step] &= ~bit;
+                }
+                if (attempt.keys != c.keys && run(attempt, candidate, 1).found) {
+                    c = attempt;
+                }
+            }
+        }
+    }
+}
+
+Case shrink(Case c, EngineType const& candidate) {
+    // Cut the run off at the first mismatching step.
+    c.steps = run(c, candidate, 1).step;
+    if (c.keys.size() > c.steps) {
+        c.keys.resize(c.steps);
+    }
+
+    // Simpler keys and operands can make more instructions removable, so
+    // repeat until no pass changes anything.
+    Case prev;
+    while (c.program != prev.program || c.keys != prev.keys) {
+        prev = c;
+        shrink_keys(c, candidate, false);
+        shrink_program(c, candidate);
+
+        // Clear operand bits one instruction at a time.
+        for (size_t n = 0; n < c.program.size(); n++) {
+            for (uint16_t mask : {0xf000, 0xf00f, 0xf0ff}) {
+                Case attempt = c;
+                attempt.program[n] &= mask;
+                if (attempt.program[n] != c.program[n] && attempt.program[n] != 0x0000 && run(attempt, candidate, 1).found) {
+                    c = attempt;
+                    break;
+                }
+            }
+        }
+    }
+
+    shrink_keys(c, candidate, true);
+
+    Divergence const d = run(c, candidate, 1);
+    c.steps = d.step;
+    if (c.keys.size() > c.steps) {
+        c.keys.resize(c.steps);
+    }
+    while (!c.keys.empty() && c.keys.back() == 0) {
+        c.keys.pop_back();
+    }
+    return c;
+}
+
+void report(Case const& c, EngineType const& candidate, Options const& opts) {
+    Divergence const d = run(c, candidate, 1);
+    std::cout << "Minimal reproducer (" << std::dec << c.steps << " steps):\n";
+    for (size_t n = 0; n < c.program.size(); n++) {
+        std::cout << "  " << hex(ROM_ADDRESS + INSTRUCTION_SIZE * n) << ": " << hex(c.program[n]) << "\n";
+    }
+    for (size_t step = 0; step < c.keys.size(); step++) {
+        if (c.keys[step] != 0) {
+            std::cout << "  keys " << hex(c.keys[step]) << " held at step " << std::dec << step << "\n";
+        }
+    }
+    std::cout << "After step " << std::dec << d.step << ": " << d.what << std::endl;
+
+    if (opts.output != "") {
+        std::ofstream out(opts.output, std::ios::binary);
+        for (uint16_t word : c.program) {
+            out.put(word >> 8);
+            out.put(word & 0xff);
+        }
+        std::ofstream keys(opts.output + ".keys");
+        for (uint16_t mask : c.keys) {
+            keys << hex(mask) << "\n";
+        }
+        std::cout << "Wrote reproducer rom to " << opts.output << " and its key schedule to " << opts.output << ".keys" << std::endl;
+    }
+}
+
+void usage(char const* argv0) {
+    std::cout << "Usage: " << argv0 << " [-e engine] [-n cases] [-l length] [-s steps] [-c interval (0 = end only)] [-r runs] [-j threads] [-S seed] [-o file] [-k keys] [rom.ch8 ...]\n";
+    std::cout << "Engines:";
+    for (size_t e = 0; e < NUM_ENGINES; e++) {
+        std::cout << " " << ENGINES[e].name;
+    }
+    std::cout << std::endl;
+    exit(2);
+}
+
+Options parse_args(int argc, char* argv[]) {
+    Options opts;
+    for (int arg = 1; arg < argc; arg++) {
+        std::string const flag = argv[arg];
+        if (flag.size() != 2 || flag[0] != '-') {
+            opts.roms.push_back(flag);
+            continue;
+        }
+        if (arg + 1 >= argc) {
+            usage(argv[0]);
+        }
+        std::string const val = argv[++arg];
+        if (flag == "-e") {
+            opts.candidate = NULL;
+            for (size_t e = 0; e < NUM_ENGINES; e++) {
+                if (val == ENGINES[e].name) {
+                    opts.candidate = &ENGINES[e];
+                }
+            }
+            if (opts.candidate == NULL) {
+                usage(argv[0]);
+            }
+        }
+        else if (flag == "-o") {
+            opts.output = val;
+        }
+        else if (flag == "-k") {
+            if (!read_keys(val, opts.replay_keys)) {
+                std::cout << "Could not read " << val << std::endl;
+                exit(2);
+            }
+            opts.replay = true;
+        }
+        else {
+            char* end = NULL;
+            unsigned long const n = std::strtoul(val.c_str(), &end, 0);
+            if (*end != '\0') {
+                usage(argv[0]);
+            }
+            switch (flag[1]) {
+            case 'n': opts.num_random = n; break;
+            case 'l': opts.stream_length = std::max(n, 1ul); break;
+            case 's': opts.max_steps = n; break;
+            case 'c': opts.compare_interval = n; break;
+            case 'r': opts.runs_per_rom = std::max(n, 1ul); break;
+            case 'j': opts.num_threads = n; break;
+            case 'S': opts.seed = n; break;
+            default: usage(argv[0]);
+            }
+        }
+    }
+    if (opts.compare_interval > opts.max_steps) {
+        usage(argv[0]);
+    }
+    // Longer streams would not fit in memory, and in-stream jump targets
+    // would spill into the opcode nibble.
+    if (opts.stream_length > (sizeof(Chip8::memory) - ROM_ADDRESS) / INSTRUCTION_SIZE) {
+        usage(argv[0]);
+    }
+    if (opts.roms.empty()) {
+        glob_t matches;
+        if (glob(DEFAULT_ROMS, 0, NULL, &matches) == 0) {
+            opts.roms.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+        }
+        globfree(&matches);
+    }
+    if (opts.num_threads == 0) {
+        opts.num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    return opts;
+}
+
+int main(int argc, char* argv[]) {
+    Options const opts = parse_args(argc, argv);
+
+    std::vector<std::vector<uint16_t>> programs(opts.roms.size());
+    for (size_t rom = 0; rom < opts.roms.size(); rom++) {
+        if (!read_rom(opts.roms[rom], programs[rom])) {
+            std::cout << "Could not read " << opts.roms[rom] << std::endl;
+            return 2;
+        }
+    }
+
+    // Jobs [0, num_random) are random streams; the rest are rom runs.
+    size_t const num_jobs = opts.num_random + opts.roms.size() * opts.runs_per_rom;
+    std::atomic<size_t> next_job(0);
+    std::atomic<size_t> steps_run(0);
+    // The lowest failing job is reported, so results do not depend on how
+    // the jobs were spread over threads. Jobs past it need not run.
+    std::atomic<size_t> first_failure(num_jobs);
+    std::mutex failure_lock;
+    Case failure;
+
+    auto worker = [&]() {
+        while (true) {
+            size_t const job = next_job++;
+            if (job >= first_failure) {
+                return;
+            }
+            Case const c = job < opts.num_random
+                ? random_case(opts, job)
+                : rom_case(opts, programs[(job - opts.num_random) / opts.runs_per_rom], (job - opts.num_random) / opts.runs_per_rom, (job - opts.num_random) % opts.runs_per_rom);
+            Divergence const d = run(c, *opts.candidate, opts.compare_interval);
+            steps_run += d.step;
+            if (d.found) {
+                std::lock_guard<std::mutex> guard(failure_lock);
+                if (job < first_failure) {
+                    first_failure = job;
+                    failure = c;
+                }
+            }
+        }
+    };
+
+    std::cout << "Checking " << opts.candidate->name << " against reference on " << std::dec << opts.num_random << " random streams and "
+              << opts.roms.size() << " roms with " << opts.num_threads << " threads." << std::endl;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < opts.num_threads; t++) {
+        threads.emplace_back(worker);
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    if (first_failure == num_jobs) {
+        std::cout << "All " << num_jobs << " cases match, running " << steps_run / std::max(num_jobs, (size_t)1) << " steps on average." << std::endl;
+        return 0;
+    }
+
+    Divergence const d = run(failure, *opts.candidate, 1);
+    std::cout << "Divergence in " << failure.name << " after step " << d.step << ": " << d.what << std::endl;
+    report(shrink(failure, *opts.candidate), *opts.candidate, opts);
+    return 1;
+}
@@ -1,5 +1,6 @@
 #include <cstdint>
 #include <algorithm> // for std::min
+#include <cstdlib> // for rand_r
 #include <cstring>
 #include <iostream> // for reading rom into memory
 
@@ -8,7 +9,7 @@
 using std::uint8_t;
 using std::uint16_t;
 
-Chip8::Chip8() {
+void Chip8::load_font() {
     uint8_t font[] = {
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
         0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -27,8 +28,11 @@ Chip8::Chip8() {
         0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
         0xF0, 0x80, 0xF0, 0x80, 0x80, // F
     };
-    std::cout << sizeof(font) << std::endl;
     std::memcpy(memory + FONT_ADDRESS, font, sizeof(font));
+}
+
+Chip8::Chip8() {
+    load_font();
 
     int ctr = 0;
     while (std::cin.peek() != -1) {
@@ -38,6 +42,11 @@ Chip8::Chip8() {
     std::cout << "Copied " << std::dec << ctr << std::hex << " bytes into rom memory." << std::endl;
 }
 
+Chip8::Chip8(uint8_t const* rom, size_t rom_size) {
+    load_font();
+    std::memcpy(memory + ROM_ADDRESS, rom, std::min(rom_size, sizeof(memory) - ROM_ADDRESS));
+}
+
 void Chip8::cls() {
     // std::cout << "Clearing screen." << std::endl;
     memset(screen, 0, NUM_PX);
@@ -153,7 +162,7 @@ void Chip8::jmpv0(uint16_t val) {
 }
 
 void Chip8::rnd(uint8_t reg, uint16_t mask) {
-    registers[reg] = (rand() % 255) & mask;
+    registers[reg] = (rand_r(&rng_state) % 255) & mask;
 }
 
 void Chip8::toggle_pixel(uint8_t row, uint8_t col) {
@@ -240,7 +249,9 @@ void Chip8::ldrange(uint8_t last_reg) {
 }
 
 void Chip8::beep() {
-    std::cout << "beep.\a" << std::endl;
+    if (verbose) {
+        std::cout << "beep.\a" << std::endl;
+    }
 }
 
 void Chip8::execute() {
@@ -250,7 +261,9 @@ void Chip8::execute() {
     }
     pc += INSTRUCTION_SIZE;
     apply_opcode(memory[pc] << 8 | memory[pc + 1]);
-    dump_state();
+    if (verbose) {
+        dump_state();
+    }
 }
 
 void Chip8::update_timers() {
@@ -272,7 +285,9 @@ void Chip8::crash() {
 }
 
 void Chip8::apply_opcode(uint16_t opcode) {
-    std::cout << "Executing opcode 0x" << opcode << " at address 0x" << pc << std::endl;
+    if (verbose) {
+        std::cout << "Executing opcode 0x" << opcode << " at address 0x" << pc << std::endl;
+    }
     if (opcode == 0x0000) {
         crash();
     }
@@ -378,7 +393,7 @@ void Chip8::apply_opcode(uint16_t opcode) {
     else if (0xf000 <= opcode && (opcode & 0x00ff) == 0x65) { // starts with f and ends with 65
         ldrange((opcode & 0x0f00) >> 8);
     }
-    else {
+    else if (verbose) {
         std::cout << "Unknown opcode " << opcode << std::endl;
     }
 }
@@ -1,12 +1,13 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define CHIP8_SCREEN_WIDTH 64
 #define CHIP8_SCREEN_HEIGHT 32
 #define NUM_PX (CHIP8_SCREEN_WIDTH * CHIP8_SCREEN_HEIGHT)
 #define NUM_KEYS 16
-#define NUM_REGISTERS 0xF
+#define NUM_REGISTERS 0x10
 #define INSTRUCTION_SIZE 2
 #define FONT_ADDRESS 0x50
 #define ROM_ADDRESS 0x200
@@ -29,13 +30,17 @@ public:
     bool keys_pressed[NUM_KEYS] = {0};
     bool waiting_for_key = false;
     uint8_t key_register = 0;
+    bool verbose = true; // Log every executed opcode to stdout.
+    unsigned int rng_state = 1; // Per-machine so that copies of a Chip8 stay deterministic.
 
     void toggle_pixel(uint8_t row, uint8_t col);
     bool get_pixel(uint8_t row, uint8_t col);
     void apply_opcode(uint16_t opcode);
     void crash();
+    void load_font();
 public:
-    Chip8();
+    Chip8(); // Reads the rom from stdin.
+    Chip8(uint8_t const* rom, size_t rom_size);
     void cls();
     void ret();
     void jmp(uint16_t addr);